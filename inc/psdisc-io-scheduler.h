@@ -0,0 +1,82 @@
+// Contents released under the The MIT License (MIT)
+
+#pragma once
+
+#include "psdisc-types.h"
+#include "psdisc-hostio.h"
+#include "psdisc-cdvd-image.h"
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// Priority classes for scheduled reads. Lower values are dispatched first: at each dispatch
+// decision the highest pending class wins, except that a class which has been passed over for
+// kPsDiscIoStarvationLimit consecutive runs is served next. Lower classes therefore keep making
+// progress under sustained realtime load, and a realtime read waits for at most the in-flight
+// run plus one such aged run, each no larger than kPsDiscIoMaxMergeBytes.
+enum PsDiscIoPriority {
+    PSDISC_IOPRIO_REALTIME      = 0,    // emulated CDVD DMA and other latency-sensitive reads
+    PSDISC_IOPRIO_NORMAL        ,       // file preload, interactive tools
+    PSDISC_IOPRIO_BACKGROUND    ,       // hashing, verification, batch jobs
+
+    PSDISC_IOPRIO_COUNT
+};
+
+// Largest single pread issued to the underlying interface. Requests larger than this are split
+// into capped sub-requests on submission, and merging never grows a run past it.
+static const psdisc_off_t kPsDiscIoMaxMergeBytes = 2048 * 128;
+
+// Number of consecutive runs a pending lower class may be passed over before it is served.
+static const int kPsDiscIoStarvationLimit = 8;
+
+// Request-queue layer that sits in front of a PsDisc_IO_Interface. Any number of threads may
+// submit reads concurrently; a single dispatch thread batches whatever is pending, sorts it by
+// LBA and issues it to the underlying pread_cb as a C-SCAN elevator sweep. Pending requests that
+// are adjacent to or overlap a run (on either side) are merged into its pread; a realtime run only
+// absorbs other realtime requests, so it is never slowed by background data. On dual-layer DVD
+// images the sweep finishes the current layer before moving to the next, and runs are never
+// merged across the layer break.
+//
+// Usage:
+//   PsDiscIoScheduler sched;
+//   sched.Start(io, desc);
+//   PsDisc_IO_Interface emu_io = sched.MakeInterface(PSDISC_IOPRIO_REALTIME);
+//   PsDisc_IO_Interface job_io = sched.MakeInterface(PSDISC_IOPRIO_BACKGROUND);
+//   ...
+//   sched.Stop();
+//
+// The scheduler must outlive any interface obtained from MakeInterface().
+struct PsDiscIoScheduler {
+    struct Request;
+
+    PsDisc_IO_Interface         m_io;
+    MediaSourceDescriptor       m_desc;
+
+    std::mutex                  m_mutex;
+    std::condition_variable     m_pending_cv;   // signals dispatcher: new work or shutdown
+    std::thread                 m_dispatcher;
+    bool                        m_running       = false;
+
+    // pending requests per priority class, keyed by image byte position (monotonic with LBA).
+    std::multimap<psdisc_off_t, Request*>   m_pending[PSDISC_IOPRIO_COUNT];
+    psdisc_off_t                            m_head_pos = 0;     // end of the last dispatched run
+    int                                     m_passed_over[PSDISC_IOPRIO_COUNT] = {};   // runs dispatched while class waited
+    std::vector<uint8_t>                    m_scratch;          // merged-run buffer, dispatcher thread only
+
+   ~PsDiscIoScheduler();
+
+    bool        Start           (const PsDisc_IO_Interface& io, const MediaSourceDescriptor& desc);
+    void        Stop            ();
+
+    intmax_t    Pread           (void* dest, intmax_t count, intmax_t pos, PsDiscIoPriority prio);
+
+    PsDisc_IO_Interface MakeInterface(PsDiscIoPriority prio);
+
+protected:
+    int         GetLayer        (psdisc_off_t pos) const;
+    Request*    PickNextRun     (psdisc_off_t& run_start, psdisc_off_t& run_end);
+    void        DispatchLoop    ();
+};
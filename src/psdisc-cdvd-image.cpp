@@ -131,6 +131,20 @@ bool DiscFS_DetectMediaDescription(MediaSourceDescriptor& desc, PsDiscFn_ioPread
         desc.offset_sector_leadin   = 8;    // mode1
     } else
 
+    // 2368 images are 2352 raw sectors with 16 bytes of subchannel Q appended, so the leadin
+    // to user data is the same as for 2352.
+    if(Has_CD001(read_cb, 2368, 24)) {
+        desc.sector_size            = 2368;
+        desc.offset_file_header     = 0;
+        desc.offset_sector_leadin   = 24;   // mode2
+    } else
+
+    if(Has_CD001(read_cb, 2368, 16)) {
+        desc.sector_size            = 2368;
+        desc.offset_file_header     = 0;
+        desc.offset_sector_leadin   = 16;   // mode1
+    } else
+
     if(Has_CD001(read_cb, 2048, 0)) {
         desc.sector_size            = 2048;
         desc.offset_file_header     = 0;
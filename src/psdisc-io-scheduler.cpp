@@ -0,0 +1,298 @@
+// Contents released under the The MIT License (MIT)
+
+#include "psdisc-io-scheduler.h"
+#include "icy_assert.h"
+#include "icy_log.h"
+#include "jfmt.h"
+
+#include <algorithm>
+#include <memory>
+#include <cstring>
+
+struct PsDiscIoScheduler::Request {
+    uint8_t*        dest;
+    intmax_t        count;
+    psdisc_off_t    pos;
+    intmax_t        result;
+    bool            done;
+    Request*        next_in_run;    // chain of requests satisfied by the same merged pread
+
+    std::condition_variable done_cv;    // wakes only this request's submitter
+};
+
+PsDiscIoScheduler::~PsDiscIoScheduler() {
+    Stop();
+}
+
+bool PsDiscIoScheduler::Start(const PsDisc_IO_Interface& io, const MediaSourceDescriptor& desc) {
+    dbg_check(!m_running, "PsDiscIoScheduler::Start called on a scheduler that is already running.");
+
+    if (!io.pread_cb) {
+        log_error("PsDiscIoScheduler: pread_cb is not set.");
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_io        = io;
+        m_desc      = desc;
+        m_head_pos  = 0;
+        m_running   = true;
+        std::fill(std::begin(m_passed_over), std::end(m_passed_over), 0);
+    }
+
+    m_dispatcher = std::thread([this]() { DispatchLoop(); });
+    return true;
+}
+
+void PsDiscIoScheduler::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+
+    // dispatcher drains any requests still pending before it exits, so that no submitter is
+    // left waiting on a request that will never complete.
+    m_pending_cv.notify_one();
+    m_dispatcher.join();
+}
+
+int PsDiscIoScheduler::GetLayer(psdisc_off_t pos) const {
+    if (m_desc.dvd_layer_break_sector <= 0) {
+        return 0;
+    }
+
+    auto break_pos = (m_desc.dvd_layer_break_sector * m_desc.getSectorSize()) + m_desc.offset_file_header;
+    return (pos >= break_pos) ? 1 : 0;
+}
+
+intmax_t PsDiscIoScheduler::Pread(void* dest, intmax_t count, intmax_t pos, PsDiscIoPriority prio) {
+    dbg_check(prio >= 0 && prio < PSDISC_IOPRIO_COUNT);
+
+    if (count <= 0) {
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (!m_running) {
+        // not started (or already stopped): behave as a plain pass-through.
+        auto pread_cb = m_io.pread_cb;
+        lock.unlock();
+        return pread_cb ? pread_cb(dest, count, pos) : -1;
+    }
+
+    // requests larger than the run cap are split so that no single pread can hold up the queue
+    // for longer than one capped run. All pieces are queued at once so they can still be swept
+    // in order (and merged with neighbours) by the dispatcher.
+    auto num_reqs = (count + kPsDiscIoMaxMergeBytes - 1) / kPsDiscIoMaxMergeBytes;
+
+    Request                     inline_req;
+    std::unique_ptr<Request[]>  split_reqs;
+    Request*                    reqs = &inline_req;
+
+    if (num_reqs > 1) {
+        split_reqs.reset(new Request[num_reqs]);
+        reqs = split_reqs.get();
+    }
+
+    for (intmax_t i = 0; i < num_reqs; ++i) {
+        auto& req = reqs[i];
+        auto  ofs = i * kPsDiscIoMaxMergeBytes;
+
+        req.dest        = (uint8_t*)dest + ofs;
+        req.count       = std::min<intmax_t>(count - ofs, kPsDiscIoMaxMergeBytes);
+        req.pos         = pos + ofs;
+        req.result      = 0;
+        req.done        = false;
+        req.next_in_run = nullptr;
+
+        m_pending[prio].insert({ req.pos, &req });
+    }
+    m_pending_cv.notify_one();
+
+    // reassemble with pread semantics: stop at the first short piece, and report an error only
+    // if nothing was read before it.
+    intmax_t    total       = 0;
+    bool        short_read  = false;
+    for (intmax_t i = 0; i < num_reqs; ++i) {
+        auto& req = reqs[i];
+        req.done_cv.wait(lock, [&]() { return req.done; });
+
+        if (short_read) {
+            continue;
+        }
+        if (req.result < 0) {
+            if (!total) {
+                total = req.result;
+            }
+            short_read = true;
+            continue;
+        }
+        total += req.result;
+        short_read = (req.result < req.count);
+    }
+
+    return total;
+}
+
+PsDisc_IO_Interface PsDiscIoScheduler::MakeInterface(PsDiscIoPriority prio) {
+    PsDisc_IO_Interface io;
+    io.pread_cb = [this, prio](void* dest, intmax_t count, intmax_t pos) {
+        return Pread(dest, count, pos, prio);
+    };
+    return io;
+}
+
+// Selects the next run to dispatch and removes its requests from the pending queues.
+// Must be called with m_mutex held. Returns nullptr if nothing is pending.
+//
+// Selection is C-SCAN over the chosen priority class: the first request at or past the head
+// position, wrapping to the lowest LBA once the sweep runs off the end. Because layer 1 follows
+// layer 0 in the image, this sweeps each layer in turn. The chosen class is the highest one
+// pending, unless a lower class has been passed over kPsDiscIoStarvationLimit times.
+//
+// Once a starting request is chosen, pending requests which overlap or are adjacent to the run on
+// either side are folded into it, up to kPsDiscIoMaxMergeBytes and never across the layer break.
+// Realtime runs only absorb realtime requests; other runs absorb requests of any class.
+PsDiscIoScheduler::Request* PsDiscIoScheduler::PickNextRun(psdisc_off_t& run_start, psdisc_off_t& run_end) {
+    int cls = 0;
+    while (cls < PSDISC_IOPRIO_COUNT && m_pending[cls].empty()) {
+        ++cls;
+    }
+
+    if (cls == PSDISC_IOPRIO_COUNT) {
+        return nullptr;
+    }
+
+    for (int lower = cls+1; lower < PSDISC_IOPRIO_COUNT; ++lower) {
+        if (!m_pending[lower].empty() && m_passed_over[lower] >= kPsDiscIoStarvationLimit) {
+            cls = lower;
+            break;
+        }
+    }
+
+    for (int k = 0; k < PSDISC_IOPRIO_COUNT; ++k) {
+        if (k == cls || m_pending[k].empty()) {
+            m_passed_over[k] = 0;
+        }
+        else if (k > cls) {
+            ++m_passed_over[k];
+        }
+    }
+
+    auto& queue = m_pending[cls];
+    auto  it    = queue.lower_bound(m_head_pos);
+    if (it == queue.end()) {
+        it = queue.begin();
+    }
+
+    Request* first = it->second;
+    Request* last  = first;
+    queue.erase(it);
+
+    run_start = first->pos;
+    run_end   = first->pos + first->count;
+
+    int layer       = GetLayer(run_start);
+    int merge_limit = (cls == PSDISC_IOPRIO_REALTIME) ? PSDISC_IOPRIO_REALTIME+1 : PSDISC_IOPRIO_COUNT;
+
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (int k = 0; k < merge_limit; ++k) {
+            auto& q = m_pending[k];
+
+            // any mergeable request must start within kPsDiscIoMaxMergeBytes of the run's end.
+            auto mit = q.lower_bound(run_end - kPsDiscIoMaxMergeBytes);
+            while (mit != q.end() && mit->first <= run_end) {
+                Request*        req     = mit->second;
+                psdisc_off_t    req_end = req->pos + req->count;
+
+                if (req_end < run_start) {
+                    ++mit;
+                    continue;
+                }
+
+                psdisc_off_t    new_start   = std::min<psdisc_off_t>(run_start, req->pos);
+                psdisc_off_t    new_end     = std::max<psdisc_off_t>(run_end,   req_end);
+
+                if ((new_end - new_start) > kPsDiscIoMaxMergeBytes || GetLayer(new_start) != layer || GetLayer(new_end - 1) != layer) {
+                    ++mit;
+                    continue;
+                }
+
+                last->next_in_run = req;
+                last = req;
+                mit  = q.erase(mit);
+
+                if (new_start < run_start || new_end > run_end) {
+                    run_start   = new_start;
+                    run_end     = new_end;
+                    grew        = true;
+                }
+            }
+        }
+    }
+
+    return first;
+}
+
+void PsDiscIoScheduler::DispatchLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (1) {
+        psdisc_off_t run_start, run_end;
+        Request* run = PickNextRun(run_start, run_end);
+
+        if (!run) {
+            if (!m_running) {
+                break;
+            }
+            m_pending_cv.wait(lock);
+            continue;
+        }
+
+        lock.unlock();
+
+        if (!run->next_in_run) {
+            // single request: read straight into the caller's buffer.
+            run->result = m_io.pread_cb(run->dest, run->count, run->pos);
+        }
+        else {
+            auto run_len = run_end - run_start;
+            if ((psdisc_off_t)m_scratch.size() < run_len) {
+                m_scratch.resize(run_len);
+            }
+
+            intmax_t ret = m_io.pread_cb(m_scratch.data(), run_len, run_start);
+
+            for (Request* req = run; req; req = req->next_in_run) {
+                if (ret < 0) {
+                    req->result = ret;
+                    continue;
+                }
+
+                auto offset = req->pos - run_start;
+                auto got    = std::min<intmax_t>(std::max<intmax_t>(ret - offset, 0), req->count);
+                if (got) {
+                    memcpy(req->dest, m_scratch.data() + offset, got);
+                }
+                req->result = got;
+            }
+        }
+
+        lock.lock();
+        m_head_pos = run_end;
+
+        // submitters can't wake until m_mutex is released, so each request (which lives on its
+        // submitter's stack) stays valid for the whole of this loop.
+        for (Request* req = run; req; req = req->next_in_run) {
+            req->done = true;
+            req->done_cv.notify_one();
+        }
+    }
+}
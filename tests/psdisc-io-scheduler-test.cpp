@@ -0,0 +1,164 @@
+// Contents released under the The MIT License (MIT)
+
+// Standalone stress and priority checks for PsDiscIoScheduler, run against an in-memory image.
+// Returns non-zero if any check fails.
+
+#include "psdisc-io-scheduler.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static const psdisc_off_t kImageSectors = 4000;
+
+static int s_failures = 0;
+
+#define test_check(cond, ...)   ((cond) || (printf("FAIL: " __VA_ARGS__), printf("\n"), ++s_failures, 0))
+
+struct MemImage {
+    std::vector<uint8_t>    data;
+    std::atomic<intmax_t>   max_pread   = { 0 };
+    std::atomic<int>        num_preads  = { 0 };
+    int                     delay_us    = 0;
+
+    MemImage() : data(kImageSectors * 2048) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = (uint8_t)((i * 7) + (i / 2048));
+        }
+    }
+
+    PsDisc_IO_Interface MakeInterface() {
+        PsDisc_IO_Interface io;
+        io.pread_cb = [this](void* dest, intmax_t count, intmax_t pos) -> intmax_t {
+            ++num_preads;
+            intmax_t prev = max_pread;
+            while (count > prev && !max_pread.compare_exchange_weak(prev, count)) {}
+
+            if (delay_us) {
+                std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+            }
+            if (pos >= (intmax_t)data.size()) {
+                return 0;
+            }
+            count = std::min<intmax_t>(count, data.size() - pos);
+            memcpy(dest, &data[pos], count);
+            return count;
+        };
+        return io;
+    }
+
+    bool Verify(const uint8_t* buf, intmax_t result, intmax_t count, intmax_t pos) const {
+        intmax_t expected = std::max<intmax_t>(0, std::min<intmax_t>(count, data.size() - pos));
+        return (result == expected) && !memcmp(buf, &data[pos], result);
+    }
+};
+
+static MediaSourceDescriptor make_desc() {
+    MediaSourceDescriptor desc = {};
+    desc.sector_size            = 2048;
+    desc.num_sectors            = kImageSectors;
+    desc.image_size             = kImageSectors * 2048;
+    desc.dvd_layer_break_sector = kImageSectors / 2;
+    return desc;
+}
+
+// many threads across all classes, unaligned and overlapping reads, including some which are
+// larger than the run cap and some which run off the end of the image.
+static void test_stress(PsDiscIoScheduler& sched, MemImage& img) {
+    std::atomic<int>            bad = { 0 };
+    std::vector<std::thread>    threads;
+
+    for (int t = 0; t < 12; ++t) {
+        threads.emplace_back([&, t]() {
+            auto io = sched.MakeInterface((PsDiscIoPriority)(t % PSDISC_IOPRIO_COUNT));
+            std::vector<uint8_t> buf(kPsDiscIoMaxMergeBytes * 3);
+
+            for (int i = 0; i < 400; ++i) {
+                intmax_t pos   = (((i * 37) + (t * 101)) % kImageSectors) * 2048 + (i % 5);
+                intmax_t count = (i % 50 == 0) ? (intmax_t)buf.size() - (i % 7) : ((i % 4) + 1) * 2000;
+
+                auto ret = io.pread_cb(buf.data(), count, pos);
+                if (!img.Verify(buf.data(), ret, count, pos)) {
+                    ++bad;
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    test_check(!bad, "stress: %d reads returned wrong data", (int)bad);
+    test_check(img.max_pread <= kPsDiscIoMaxMergeBytes, "stress: pread of %jd bytes exceeds run cap", (intmax_t)img.max_pread);
+}
+
+// a background read must complete while realtime load is sustained.
+static void test_starvation(PsDiscIoScheduler& sched, MemImage& img) {
+    std::atomic<bool>           bg_done = { false };
+    std::vector<std::thread>    threads;
+
+    img.delay_us = 100;
+
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            auto io = sched.MakeInterface(PSDISC_IOPRIO_REALTIME);
+            uint8_t buf[2048];
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            for (int i = 0; !bg_done && std::chrono::steady_clock::now() < deadline; ++i) {
+                io.pread_cb(buf, sizeof(buf), ((i * 13 + t * 501) % kImageSectors) * 2048);
+            }
+        });
+    }
+
+    // let the realtime load build up before submitting.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    uint8_t buf[2048];
+    auto io     = sched.MakeInterface(PSDISC_IOPRIO_BACKGROUND);
+    auto start  = std::chrono::steady_clock::now();
+    auto ret    = io.pread_cb(buf, sizeof(buf), 1234 * 2048);
+    auto waited = std::chrono::steady_clock::now() - start;
+    bg_done = true;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    img.delay_us = 0;
+
+    auto waited_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(waited).count();
+    test_check(img.Verify(buf, ret, sizeof(buf), 1234 * 2048), "starvation: background read returned wrong data");
+    test_check(waited_ms < 1000, "starvation: background read waited %d ms under realtime load", waited_ms);
+}
+
+int main() {
+    MemImage            img;
+    PsDiscIoScheduler   sched;
+
+    test_check(sched.Start(img.MakeInterface(), make_desc()), "Start failed");
+    test_stress(sched, img);
+    test_starvation(sched, img);
+    sched.Stop();
+
+    // the scheduler must be restartable after Stop(), and pass through while stopped.
+    uint8_t buf[4096];
+    test_check(img.Verify(buf, sched.Pread(buf, sizeof(buf), 2048 * 7 + 3, PSDISC_IOPRIO_NORMAL), sizeof(buf), 2048 * 7 + 3),
+        "pass-through read while stopped returned wrong data");
+
+    test_check(sched.Start(img.MakeInterface(), make_desc()), "restart failed");
+    test_stress(sched, img);
+    sched.Stop();
+
+    if (s_failures) {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}
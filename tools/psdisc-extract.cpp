@@ -0,0 +1,433 @@
+// Contents released under the The MIT License (MIT)
+
+// psdisc-extract - dumps the entire filesystem of a PS1/PS2 disc image to a host directory.
+//
+// Usage: psdisc-extract [-j threads] <image> <outdir>
+//
+// Files are extracted in parallel. For 2048-byte (ISO) images, file data is copied with
+// copy_file_range() so that it never crosses user space. On filesystems with reflink support
+// (btrfs, xfs) the kernel clones extents only when source offset, dest offset and length are
+// block aligned (typically 4KiB); files starting on an odd LBA are copied in-kernel instead.
+//
+// For raw 2352/2368 images, a batch of sectors is read in one pread and the 2048-byte user data
+// of each sector is gathered straight out of the read buffer with pwritev(), so sector framing is
+// stripped without an intermediate copy. Files containing Mode 2 Form 2 sectors (PS1 XA audio,
+// STR movies) hold 2324 bytes of data per sector which a 2048-byte copy would truncate; these are
+// instead extracted as raw 2336-byte Mode 2 sectors (subheader + data + EDC), the same layout
+// XA/STR tools expect.
+
+#include "psdisc-filesystem.h"
+#include "psdisc-cdvd-image.h"
+#include "icy_log.h"
+#include "jfmt.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static const int            kRawSectorsPerBatch     = 256;              // must not exceed IOV_MAX
+static const psdisc_off_t   kSectorSize_Mode2       = 2336;             // subheader + form1/form2 data + EDC
+static const int            kSubmodeForm2           = 0x20;
+static const psdisc_off_t   kFallbackCopyBufferSize = 1024 * 1024;
+
+struct ExtractItem {
+    psdisc_off_t    sector;
+    psdisc_off_t    length;
+    std::string     path;
+};
+
+struct ExtractContext {
+    MediaSourceDescriptor   desc;
+    int                     image_fd;
+
+    // byte position of sector's user data within the image file.
+    psdisc_off_t GetDataPos(psdisc_off_t sector) const {
+        return (sector * desc.getSectorSize()) + desc.offset_file_header + desc.offset_sector_leadin;
+    }
+
+    bool IsCooked() const {
+        return desc.sector_size == kSectorSize_2048;
+    }
+
+    // CD-XA Mode 2 images carry an 8-byte subheader immediately before the user data.
+    bool HasSubheader() const {
+        return !IsCooked() && (desc.offset_file_header + desc.offset_sector_leadin) == 24;
+    }
+};
+
+static bool write_all(int fd, const uint8_t* src, psdisc_off_t length, psdisc_off_t pos)
+{
+    while (length > 0) {
+        auto ret = pwrite(fd, src, length, pos);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        src     += ret;
+        pos     += ret;
+        length  -= ret;
+    }
+    return true;
+}
+
+// Fallback used when copy_file_range is unavailable or refuses the copy (old kernels, or source
+// and dest on filesystems that don't support cross-fs copies).
+static bool extract_cooked_buffered(const ExtractContext& ctx, int out_fd, psdisc_off_t in_pos, psdisc_off_t out_pos, psdisc_off_t length)
+{
+    std::vector<uint8_t> buf(std::min(length, kFallbackCopyBufferSize));
+
+    while (length > 0) {
+        auto chunk = std::min<psdisc_off_t>(length, buf.size());
+        auto ret   = pread(ctx.image_fd, buf.data(), chunk, in_pos);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        if (!write_all(out_fd, buf.data(), ret, out_pos)) {
+            return false;
+        }
+        in_pos  += ret;
+        out_pos += ret;
+        length  -= ret;
+    }
+    return true;
+}
+
+static bool extract_cooked(const ExtractContext& ctx, int out_fd, const ExtractItem& item)
+{
+    psdisc_off_t in_pos  = ctx.GetDataPos(item.sector);
+    psdisc_off_t out_pos = 0;
+    psdisc_off_t length  = item.length;
+
+#if defined(__linux__)
+    while (length > 0) {
+        loff_t in_off  = in_pos;
+        loff_t out_off = out_pos;
+
+        auto ret = copy_file_range(ctx.image_fd, &in_off, out_fd, &out_off, length, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            // unsupported by kernel/filesystem, or source is truncated (ret==0).
+            // the buffered path finishes the copy or reports the error.
+            break;
+        }
+        in_pos  += ret;
+        out_pos += ret;
+        length  -= ret;
+    }
+
+    if (!length) {
+        return true;
+    }
+#endif
+
+    return extract_cooked_buffered(ctx, out_fd, in_pos, out_pos, length);
+}
+
+enum RawExtractResult {
+    RAW_EXTRACT_OK,
+    RAW_EXTRACT_FAILED,
+    RAW_EXTRACT_NEEDS_MODE2,    // found a Form 2 sector while writing 2048-byte user data
+};
+
+// Form 2 is flagged in the subheader submode byte. The subheader is stored twice; requiring both
+// copies to agree keeps stray data in non-XA images from being misread as Form 2.
+static bool is_form2_sector(const uint8_t* userdata)
+{
+    const uint8_t* subheader = userdata - 8;
+    return (subheader[2] & kSubmodeForm2) && (subheader[2] == subheader[6]);
+}
+
+// rawbuf is owned by the calling worker and reused across files; it is grown only as large as
+// the biggest batch seen so far, so small files don't pay for a full batch-sized allocation.
+//
+// mode2 selects the raw 2336-byte output layout. When unset, extraction stops with
+// RAW_EXTRACT_NEEDS_MODE2 at the first Form 2 sector so that the caller can restart the file.
+static RawExtractResult extract_raw(const ExtractContext& ctx, int out_fd, const ExtractItem& item, std::vector<uint8_t>& rawbuf, bool mode2)
+{
+    auto sector_size = ctx.desc.getSectorSize();
+    auto leadin      = mode2 ? ctx.desc.offset_sector_leadin - 8  : ctx.desc.offset_sector_leadin;
+    auto out_size    = mode2 ? kSectorSize_Mode2                  : 2048;
+
+    struct iovec            iov[kRawSectorsPerBatch];
+
+    psdisc_off_t sector    = item.sector;
+    psdisc_off_t remaining = mode2 ? ((item.length + 2047) / 2048) * out_size : item.length;
+    psdisc_off_t out_pos   = 0;
+
+    while (remaining > 0) {
+        auto num_sectors = std::min<psdisc_off_t>((remaining + out_size - 1) / out_size, kRawSectorsPerBatch);
+        auto read_len    = num_sectors * sector_size;
+        auto read_pos    = (sector * sector_size) + ctx.desc.offset_file_header;
+
+        if ((psdisc_off_t)rawbuf.size() < read_len) {
+            rawbuf.resize(read_len);
+        }
+
+        auto ret = pread(ctx.image_fd, rawbuf.data(), read_len, read_pos);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // the final sector of an image may legitimately be short by any trailing error-correction
+        // bytes, so only require that the user data itself was read.
+        auto last_data_end = ((num_sectors - 1) * sector_size) + leadin
+                           + std::min<psdisc_off_t>(remaining - ((num_sectors - 1) * out_size), out_size);
+        if (ret < last_data_end) {
+            log_error("%s: read error or truncated image at sector %jd", item.path.c_str(), JFMT(sector));
+            return RAW_EXTRACT_FAILED;
+        }
+
+        psdisc_off_t batch_len = 0;
+        for (int i = 0; i < num_sectors; ++i) {
+            auto sector_data = rawbuf.data() + (i * sector_size) + leadin;
+            if (!mode2 && ctx.HasSubheader() && is_form2_sector(sector_data)) {
+                return RAW_EXTRACT_NEEDS_MODE2;
+            }
+
+            auto len = std::min<psdisc_off_t>(remaining - batch_len, out_size);
+            iov[i].iov_base = sector_data;
+            iov[i].iov_len  = len;
+            batch_len += len;
+        }
+
+        // pwritev may complete partially; advance through the iovec list until the batch is out.
+        int             iov_idx = 0;
+        psdisc_off_t    written = 0;
+        while (written < batch_len) {
+            auto wret = pwritev(out_fd, iov + iov_idx, num_sectors - iov_idx, out_pos + written);
+            if (wret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (wret <= 0) {
+                log_error("%s: write failed: %s", item.path.c_str(), strerror(errno));
+                return RAW_EXTRACT_FAILED;
+            }
+            written += wret;
+            while (wret > 0 && (psdisc_off_t)iov[iov_idx].iov_len <= wret) {
+                wret -= iov[iov_idx].iov_len;
+                ++iov_idx;
+            }
+            if (wret > 0) {
+                iov[iov_idx].iov_base  = (uint8_t*)iov[iov_idx].iov_base + wret;
+                iov[iov_idx].iov_len  -= wret;
+            }
+        }
+
+        sector    += num_sectors;
+        out_pos   += batch_len;
+        remaining -= batch_len;
+    }
+
+    return RAW_EXTRACT_OK;
+}
+
+static bool extract_file(const ExtractContext& ctx, const ExtractItem& item, std::vector<uint8_t>& rawbuf)
+{
+    int out_fd = open(item.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        log_error("%s: open failed: %s", item.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool result;
+    if (ctx.IsCooked()) {
+        result = extract_cooked(ctx, out_fd, item);
+    }
+    else {
+        auto raw_result = extract_raw(ctx, out_fd, item, rawbuf, false);
+
+        // Form 2 sectors are usually at the very start of XA/STR files, so restarting the file
+        // is cheaper than scanning every file's subheaders up front.
+        if (raw_result == RAW_EXTRACT_NEEDS_MODE2) {
+            log_host("%s: contains Mode 2 Form 2 sectors, extracting as raw %jd-byte sectors.", item.path.c_str(), JFMT(kSectorSize_Mode2));
+            raw_result = ftruncate(out_fd, 0)
+                ? RAW_EXTRACT_FAILED
+                : extract_raw(ctx, out_fd, item, rawbuf, true);
+        }
+        result = (raw_result == RAW_EXTRACT_OK);
+    }
+
+    if (!result) {
+        log_error("%s: extraction failed.", item.path.c_str());
+    }
+
+    close(out_fd);
+    return result;
+}
+
+// ISO names carry a ";1" version suffix which is dropped on extraction. Anything which could
+// escape the output directory is replaced.
+static std::string make_host_name(const uint8_t* name, int nameLen)
+{
+    std::string result((const char*)name, nameLen);
+
+    auto semi = result.find(';');
+    if (semi != std::string::npos) {
+        result.resize(semi);
+    }
+
+    for (auto& ch : result) {
+        if (ch == '/' || ch == '\\' || ch == 0) {
+            ch = '_';
+        }
+    }
+
+    if (result.empty() || result == "." || result == "..") {
+        result = "_";
+    }
+
+    return result;
+}
+
+static void print_usage()
+{
+    log_error("usage: psdisc-extract [-j threads] <image> <outdir>");
+}
+
+int main(int argc, char** argv)
+{
+    int         num_threads = std::max(1u, std::thread::hardware_concurrency());
+    const char* image_path  = nullptr;
+    const char* out_path    = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-j") && (i+1) < argc) {
+            num_threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (!image_path) {
+            image_path = argv[i];
+        }
+        else if (!out_path) {
+            out_path = argv[i];
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (!image_path || !out_path) {
+        print_usage();
+        return 1;
+    }
+
+    ExtractContext ctx = {};
+
+    ctx.image_fd = open(image_path, O_RDONLY);
+    if (ctx.image_fd < 0) {
+        log_error("%s: open failed: %s", image_path, strerror(errno));
+        return 1;
+    }
+
+    if (!DiscFS_DetectMediaDescription(ctx.desc, ctx.image_fd)) {
+        log_error("%s: unrecognized disc image.", image_path);
+        return 1;
+    }
+
+    PsDiscDirParser parser = {};
+    parser.read_data_cb = [&](uint8_t* dest, psdisc_off_t sector, psdisc_off_t offset, psdisc_off_t length) {
+        // directory records are read a sector at a time so that raw framing can be skipped.
+        while (length > 0) {
+            auto insec = std::min<psdisc_off_t>(length, 2048 - offset);
+            if (pread(ctx.image_fd, dest, insec, ctx.GetDataPos(sector) + offset) != insec) {
+                return false;
+            }
+            dest   += insec;
+            length -= insec;
+            offset  = 0;
+            ++sector;
+        }
+        return true;
+    };
+
+    if (mkdir(out_path, 0755) && errno != EEXIST) {
+        log_error("%s: mkdir failed: %s", out_path, strerror(errno));
+        return 1;
+    }
+
+    // directories are reported before their contents, so parent paths are always known by the
+    // time a child is added. Directories are created here, serially; only file data extraction
+    // is parallelized.
+    std::map<psdisc_off_t, std::string> dir_paths;
+    std::vector<ExtractItem>            files;
+    bool                                tree_ok = true;
+
+    dir_paths[parser.FindRootSector()] = out_path;
+
+    bool parsed = parser.ReadFilesystem([&](psdisc_off_t secstart, psdisc_off_t len, int type, const uint8_t* name, int nameLen, psdisc_off_t parent) {
+        auto pit = dir_paths.find(parent);
+        if (pit == dir_paths.end()) {
+            log_error("orphaned directory entry at sector %jd", JFMT(secstart));
+            tree_ok = false;
+            return;
+        }
+
+        auto path = pit->second + "/" + make_host_name(name, nameLen);
+
+        if (type == FILETYPE_DIR) {
+            if (mkdir(path.c_str(), 0755) && errno != EEXIST) {
+                log_error("%s: mkdir failed: %s", path.c_str(), strerror(errno));
+                tree_ok = false;
+            }
+            dir_paths[secstart] = path;
+        }
+        else {
+            files.push_back({ secstart, len, path });
+        }
+    });
+
+    if (!parsed) {
+        log_error("%s: failed to read filesystem.", image_path);
+        return 1;
+    }
+
+    // issue extraction roughly in disc order so that concurrent workers sweep the image forward.
+    std::sort(files.begin(), files.end(), [](const ExtractItem& a, const ExtractItem& b) {
+        return a.sector < b.sector;
+    });
+
+    std::atomic<size_t>     next_item   = { 0 };
+    std::atomic<int>        num_errors  = { 0 };
+    std::vector<std::thread> workers;
+
+    num_threads = std::min<int>(num_threads, std::max<size_t>(files.size(), 1));
+
+    for (int t = 0; t < num_threads; ++t) {
+        workers.emplace_back([&]() {
+            std::vector<uint8_t> rawbuf;
+            size_t idx;
+            while ((idx = next_item++) < files.size()) {
+                if (!extract_file(ctx, files[idx], rawbuf)) {
+                    ++num_errors;
+                }
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    close(ctx.image_fd);
+
+    log_host("extracted %jd files (%d errors) using %d threads", JFMT(files.size()), (int)num_errors, num_threads);
+    return (num_errors || !tree_ok) ? 1 : 0;
+}